@@ -1,5 +1,8 @@
 # FLAGS="game.c -o game -O2 -Wall"
 FLAGS="new_game_plus.c -o game -O2 -Wall"
+# FLAGS="spectator_bench.c -o game -O2 -Wall"
+# FLAGS="endless.c -o game -O2 -Wall"
+# FLAGS="solver.c -o game -O2 -Wall"
 
 clang $FLAGS -framework SDL2
 # gcc $FLAGS -mwindow -lmingw32 -lSDL2main -lSDL2
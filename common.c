@@ -28,7 +28,9 @@ typedef _Bool bool;
 
 #define BIT(n) (1 << (n))
 
-u64 xorshift128plus_random_seed[2] = { ~0, ~0 };
+// Each thread has its own generator, so levels can be generated off the
+// main thread without disturbing it.
+_Thread_local u64 xorshift128plus_random_seed[2] = { ~0, ~0 };
 
 u64 xorshift128plus() {
     u64 x = xorshift128plus_random_seed[0];
@@ -0,0 +1,482 @@
+#include <SDL2/SDL.h>
+#include "common.c"
+#include "level.c"
+
+/*
+    endless.c - An endless dungeon built from lazily generated chunks
+
+    The world is split into CHUNK_SIZE square chunks, each generated from the
+    world seed and its coordinates the first time the view comes near it.
+    Only MAX_CHUNKS are kept in memory; the least recently used one is evicted
+    to make room. Entities placed by the generator remember where they were
+    placed, so when one is collected or killed that is recorded in a small
+    per-chunk bitset, and a regenerated chunk comes back without it.
+*/
+
+SDL_Window * window;
+SDL_Renderer * renderer;
+SDL_Texture * sprite_texture;
+SDL_Texture * font_texture;
+
+const int view_width  = 16;
+const int view_height = 16;
+const int tile_size = 32;
+
+const int window_width  = (view_width+2)  * tile_size;
+const int window_height = (view_height+2) * tile_size;
+
+typedef struct {
+    int score;
+    int enemies_defeated;
+    int health;
+} Session;
+
+typedef struct {
+    int x;
+    int y;
+} Player;
+
+enum {
+    UP = 1,
+    DOWN,
+    LEFT,
+    RIGHT,
+};
+
+struct {
+    u16 x, y;
+    u8 r, g, b;
+    u8 flags;
+} sprite_table[] = {
+    [0] = {},
+    [FLOOR]       = { 10,  7, 124, 175, 194, 0 },
+    [SPIDER]      = {  3,  3, 186, 139, 175, 0 },
+    [SPIKES]      = { 11,  6, 124, 175, 194, 0 },
+    [PLAYER]      = {  3,  0, 161, 181, 108, 0 },
+    [WALL]        = {  2,  8, 216, 216, 216, 0 },
+    [EXIT]        = {  5,  7, 216, 216, 216, 0 },
+    [LOCK]        = {  4,  7, 216, 216, 216, 0 },
+    [KEY]         = {  2, 11, 247, 202, 136, 0 },
+    [GOLD_SMALL]  = {  0,  9, 247, 202, 136, 0 },
+    [GOLD_LARGE]  = {  0, 10, 247, 202, 136, 0 },
+};
+
+void draw_sprite(int sprite_index, int x, int y) {
+    if (sprite_index) {
+        int sx = sprite_table[sprite_index].x * tile_size;
+        int sy = sprite_table[sprite_index].y * tile_size;
+        int r = sprite_table[sprite_index].r;
+        int g = sprite_table[sprite_index].g;
+        int b = sprite_table[sprite_index].b;
+        SDL_SetTextureColorMod(sprite_texture, r, g, b);
+        SDL_RenderCopyEx(renderer, sprite_texture,
+            &(SDL_Rect){ sx, sy, tile_size, tile_size },
+            &(SDL_Rect){  x,  y, tile_size, tile_size },
+            0, 0, 0);
+        SDL_SetTextureColorMod(sprite_texture, 255, 255, 255);
+    }
+}
+
+void draw_number(int number, int x, int y) {
+    const int font_width  = 8;
+    const int font_height = 8;
+    char string[64];
+    snprintf(string, 64, "%d", number);
+    for (char * c = string; *c; ++c) {
+        int sx = (*c - '0') * font_width;
+        SDL_RenderCopy(renderer, font_texture,
+            &(SDL_Rect){ sx, 0, font_width, font_height },
+            &(SDL_Rect){  x, y, font_width, font_height });
+        x += font_width;
+    }
+}
+
+#define CHUNK_SHIFT 4
+#define CHUNK_SIZE (1 << CHUNK_SHIFT)
+#define CHUNK_TILES (CHUNK_SIZE * CHUNK_SIZE)
+#define MAX_CHUNKS 64
+#define CHUNK_TABLE_SIZE 128 // Power of two, at least twice MAX_CHUNKS.
+
+// Set on entities placed by the generator. The low byte of the flags holds
+// the index in the chunk where it was placed, which moves with the entity.
+#define GENERATED BIT(8)
+
+typedef struct {
+    int x;
+    int y;
+    bool used;
+    u64 last_used;
+    Tile tiles[CHUNK_TILES];
+} Chunk;
+
+// Which generated entities have been removed from a chunk, by placement.
+typedef struct {
+    int x;
+    int y;
+    u8 removed[CHUNK_TILES / 8];
+} ChunkDiff;
+
+typedef struct {
+    u64 seed;
+    u64 clock;
+    Chunk chunks[MAX_CHUNKS];
+    int table[CHUNK_TABLE_SIZE]; // Chunk index + 1, or 0 if empty.
+    ChunkDiff * diffs;
+    int diff_count;
+    int diff_capacity;
+    int * diff_table; // Diff index + 1, or 0 if empty.
+    int diff_table_size;
+    u64 chunks_generated;
+    u64 chunks_evicted;
+} World;
+
+u32 hash_position(int x, int y) {
+    return (u32)x * 73856093u ^ (u32)y * 19349663u;
+}
+
+u32 hash_chunk(int x, int y) {
+    return hash_position(x, y) & (CHUNK_TABLE_SIZE - 1);
+}
+
+int find_chunk(World * world, int x, int y) {
+    for (u32 h = hash_chunk(x, y); world->table[h]; h = (h + 1) & (CHUNK_TABLE_SIZE - 1)) {
+        Chunk * chunk = &world->chunks[world->table[h] - 1];
+        if (chunk->x == x && chunk->y == y) return world->table[h] - 1;
+    }
+    return -1;
+}
+
+void insert_chunk(World * world, int index) {
+    u32 h = hash_chunk(world->chunks[index].x, world->chunks[index].y);
+    while (world->table[h]) h = (h + 1) & (CHUNK_TABLE_SIZE - 1);
+    world->table[h] = index + 1;
+}
+
+// Removes a chunk from the table, shifting back any entries that probed
+// past it so lookups never stop early.
+void remove_chunk(World * world, int index) {
+    u32 h = hash_chunk(world->chunks[index].x, world->chunks[index].y);
+    while (world->table[h] != index + 1) h = (h + 1) & (CHUNK_TABLE_SIZE - 1);
+    world->table[h] = 0;
+
+    for (u32 next = (h + 1) & (CHUNK_TABLE_SIZE - 1); world->table[next];
+        next = (next + 1) & (CHUNK_TABLE_SIZE - 1)) {
+        Chunk * chunk = &world->chunks[world->table[next] - 1];
+        u32 home = hash_chunk(chunk->x, chunk->y);
+        // Move it back into the hole unless its home lies between the hole
+        // and where it is now.
+        if (((next - home) & (CHUNK_TABLE_SIZE - 1)) >= ((next - h) & (CHUNK_TABLE_SIZE - 1))) {
+            world->table[h] = world->table[next];
+            world->table[next] = 0;
+            h = next;
+        }
+    }
+}
+
+// Diffs are never removed, so their table only has to grow.
+void grow_diff_table(World * world) {
+    free(world->diff_table);
+    world->diff_table_size = MAX(64, world->diff_table_size * 2);
+    world->diff_table = calloc(world->diff_table_size, sizeof(int));
+    if (!world->diff_table) panic_exit("Could not allocate chunk diffs.");
+    int mask = world->diff_table_size - 1;
+    for (int i = 0; i < world->diff_count; ++i) {
+        u32 h = hash_position(world->diffs[i].x, world->diffs[i].y) & mask;
+        while (world->diff_table[h]) h = (h + 1) & mask;
+        world->diff_table[h] = i + 1;
+    }
+}
+
+ChunkDiff * find_diff(World * world, int x, int y, bool create) {
+    int mask = world->diff_table_size - 1;
+    u32 h = hash_position(x, y) & mask;
+    if (world->diff_table) {
+        for (; world->diff_table[h]; h = (h + 1) & mask) {
+            ChunkDiff * diff = &world->diffs[world->diff_table[h] - 1];
+            if (diff->x == x && diff->y == y) return diff;
+        }
+    }
+    if (!create) return NULL;
+
+    if (world->diff_count == world->diff_capacity) {
+        world->diff_capacity = MAX(16, world->diff_capacity * 2);
+        world->diffs = realloc(world->diffs, world->diff_capacity * sizeof(ChunkDiff));
+        if (!world->diffs) panic_exit("Could not allocate chunk diffs.");
+    }
+    ChunkDiff * diff = &world->diffs[world->diff_count++];
+    *diff = (ChunkDiff){ .x = x, .y = y };
+
+    if (world->diff_count * 2 > world->diff_table_size) {
+        grow_diff_table(world);
+    } else {
+        world->diff_table[h] = world->diff_count;
+    }
+    return diff;
+}
+
+void generate_chunk(World * world, Chunk * chunk) {
+    // Chunks are generated from their own seed, leaving the main sequence
+    // (used for spider movement) where it was.
+    u64 saved_seed[2] = { xorshift128plus_random_seed[0], xorshift128plus_random_seed[1] };
+    u64 position = (u64)(u32)chunk->x << 32 | (u32)chunk->y;
+    seed_rng(world->seed ^ position, world->seed);
+
+    for (int i = 0; i < CHUNK_TILES; ++i) {
+        Tile tile = {};
+
+        tile.type = chance(0.2f) ? WALL : FLOOR;
+
+        if (tile.type == FLOOR) {
+            if      (chance(0.05f)) tile.entity = GOLD_SMALL;
+            else if (chance(0.01f)) tile.entity = GOLD_LARGE;
+            else if (chance(0.03f)) tile.entity = SPIDER;
+            else if (chance(0.02f)) tile.type = SPIKES;
+        }
+        if (tile.entity) tile.flags = GENERATED | i;
+
+        chunk->tiles[i] = tile;
+    }
+
+    // Somewhere safe to start.
+    if (chunk->x == 0 && chunk->y == 0) {
+        chunk->tiles[0] = (Tile){ .type = FLOOR };
+    }
+
+    xorshift128plus_random_seed[0] = saved_seed[0];
+    xorshift128plus_random_seed[1] = saved_seed[1];
+
+    ChunkDiff * diff = find_diff(world, chunk->x, chunk->y, false);
+    if (diff) {
+        for (int i = 0; i < CHUNK_TILES; ++i) {
+            if (diff->removed[i / 8] & BIT(i % 8)) {
+                chunk->tiles[i].entity = 0;
+                chunk->tiles[i].flags = 0;
+            }
+        }
+    }
+    world->chunks_generated += 1;
+}
+
+// Returns the chunk at the given chunk coordinates, generating it if it is
+// not loaded. Pointers to other chunks stay valid until MAX_CHUNKS more have
+// been touched.
+Chunk * get_chunk(World * world, int x, int y) {
+    world->clock += 1;
+    int index = find_chunk(world, x, y);
+    if (index < 0) {
+        index = 0;
+        for (int i = 0; i < MAX_CHUNKS; ++i) {
+            if (!world->chunks[i].used) {
+                index = i;
+                break;
+            }
+            if (world->chunks[i].last_used < world->chunks[index].last_used) index = i;
+        }
+        Chunk * chunk = &world->chunks[index];
+        if (chunk->used) {
+            remove_chunk(world, index);
+            world->chunks_evicted += 1;
+        }
+        chunk->x = x;
+        chunk->y = y;
+        chunk->used = true;
+        generate_chunk(world, chunk);
+        insert_chunk(world, index);
+    }
+    world->chunks[index].last_used = world->clock;
+    return &world->chunks[index];
+}
+
+Tile * get_tile(World * world, int x, int y) {
+    Chunk * chunk = get_chunk(world, x >> CHUNK_SHIFT, y >> CHUNK_SHIFT);
+    return &chunk->tiles[(x & (CHUNK_SIZE-1)) + (y & (CHUNK_SIZE-1)) * CHUNK_SIZE];
+}
+
+// Removes the entity on a tile, remembering it if it came from the generator.
+void remove_entity(World * world, int x, int y) {
+    Tile * tile = get_tile(world, x, y);
+    if (tile->flags & GENERATED) {
+        ChunkDiff * diff = find_diff(world, x >> CHUNK_SHIFT, y >> CHUNK_SHIFT, true);
+        int i = tile->flags & 0xFF;
+        diff->removed[i / 8] |= BIT(i % 8);
+    }
+    tile->entity = 0;
+    tile->flags = 0;
+}
+
+// Loads every chunk within margin tiles of the given rectangle.
+void load_chunks(World * world, int x, int y, int width, int height, int margin) {
+    for (int cy = (y - margin) >> CHUNK_SHIFT; cy <= (y + height + margin) >> CHUNK_SHIFT; ++cy) {
+        for (int cx = (x - margin) >> CHUNK_SHIFT; cx <= (x + width + margin) >> CHUNK_SHIFT; ++cx) {
+            get_chunk(world, cx, cy);
+        }
+    }
+}
+
+// Spiders wander within their own chunk, and only near the player.
+void update_spiders(Chunk * chunk, Player * player) {
+    Tile new_tiles[CHUNK_TILES];
+    memcpy(new_tiles, chunk->tiles, sizeof(new_tiles));
+
+    for (int y = 0; y < CHUNK_SIZE; ++y) {
+        for (int x = 0; x < CHUNK_SIZE; ++x) {
+            Tile * old  = &chunk->tiles[x + y * CHUNK_SIZE];
+            Tile * tile = &new_tiles[x + y * CHUNK_SIZE];
+            if (old->entity != SPIDER) continue;
+
+            int new_x = x;
+            int new_y = y;
+            int direction = random_int_range(UP, RIGHT);
+            if (direction == UP)    --new_y;
+            if (direction == DOWN)  ++new_y;
+            if (direction == LEFT)  --new_x;
+            if (direction == RIGHT) ++new_x;
+            if (new_x < 0 || new_x >= CHUNK_SIZE || new_y < 0 || new_y >= CHUNK_SIZE) continue;
+
+            int world_x = chunk->x * CHUNK_SIZE + new_x;
+            int world_y = chunk->y * CHUNK_SIZE + new_y;
+            Tile * new_pos = &new_tiles[new_x + new_y * CHUNK_SIZE];
+            if (new_pos->type == WALL || new_pos->entity ||
+                (world_x == player->x && world_y == player->y)) {
+                continue;
+            }
+
+            *new_pos = (Tile){ new_pos->type, SPIDER, tile->flags };
+            tile->entity = 0;
+            tile->flags = 0;
+        }
+    }
+    memcpy(chunk->tiles, new_tiles, sizeof(new_tiles));
+}
+
+void update_world(World * world, Player * player, int direction, Session * session) {
+    int new_x = player->x;
+    int new_y = player->y;
+    if (direction == UP)    --new_y;
+    if (direction == DOWN)  ++new_y;
+    if (direction == LEFT)  --new_x;
+    if (direction == RIGHT) ++new_x;
+
+    Tile * new_pos = get_tile(world, new_x, new_y);
+    if (new_pos->type != WALL) {
+        if (new_pos->type == SPIKES) session->health -= 1;
+
+        if (new_pos->entity == GOLD_SMALL) {
+            session->score += 3;
+        } else if (new_pos->entity == GOLD_LARGE) {
+            session->score += 20;
+        } else if (new_pos->entity == SPIDER) {
+            session->enemies_defeated += 1;
+        }
+        if (new_pos->entity) remove_entity(world, new_x, new_y);
+
+        player->x = new_x;
+        player->y = new_y;
+    }
+
+    int cx = player->x >> CHUNK_SHIFT;
+    int cy = player->y >> CHUNK_SHIFT;
+    for (int y = cy - 1; y <= cy + 1; ++y) {
+        for (int x = cx - 1; x <= cx + 1; ++x) {
+            update_spiders(get_chunk(world, x, y), player);
+        }
+    }
+}
+
+int main(int argc, char ** argv) {
+    if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
+        panic_exit("Could not initialise SDL2.\n(%s)", SDL_GetError());
+    }
+
+    window = SDL_CreateWindow("",
+        SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+        window_width, window_height, 0);
+    if (window == NULL) {
+        panic_exit("Could not create window.\n(%s)", SDL_GetError());
+    }
+
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_PRESENTVSYNC);
+    if (renderer == NULL) {
+        panic_exit("Could not create renderer.\n(%s)", SDL_GetError());
+    }
+    SDL_RenderSetLogicalSize(renderer, window_width, window_height);
+    SDL_RenderSetIntegerScale(renderer, true);
+
+    seed_rng(~SDL_GetPerformanceCounter(), SDL_GetTicks());
+
+    {
+        SDL_Surface * surface = SDL_LoadBMP("sheet.bmp");
+        if (surface == NULL) {
+            panic_exit("Could not load sprite sheet.\n(%s)", SDL_GetError());
+        }
+        sprite_texture = SDL_CreateTextureFromSurface(renderer, surface);
+        if (sprite_texture == NULL) {
+            panic_exit("Could not create sprite sheet texture.\n(%s)", SDL_GetError());
+        }
+        SDL_FreeSurface(surface);
+    }
+
+    {
+        SDL_Surface * surface = SDL_LoadBMP("digits.bmp");
+        if (surface == NULL) {
+            panic_exit("Could not load sprite sheet.\n(%s)", SDL_GetError());
+        }
+        font_texture = SDL_CreateTextureFromSurface(renderer, surface);
+        if (font_texture == NULL) {
+            panic_exit("Could not create sprite sheet texture.\n(%s)", SDL_GetError());
+        }
+        SDL_FreeSurface(surface);
+    }
+
+    World * world = calloc(1, sizeof(World));
+    if (!world) panic_exit("Could not allocate world.");
+    world->seed = argc > 1 ? strtoull(argv[1], NULL, 0) : xorshift128plus();
+    fprintf(stderr, "world seed: %llu\n", (unsigned long long)world->seed);
+
+    Player player = {};
+    Session session = { .health = 10 };
+
+    while (true) {
+        SDL_Event event;
+        while (SDL_PollEvent(&event)) {
+            if (event.type == SDL_QUIT) exit(0);
+
+            if (event.type == SDL_KEYDOWN) {
+                SDL_Scancode sc = event.key.keysym.scancode;
+                int direction = 0;
+                if (sc == SDL_SCANCODE_UP    || sc == SDL_SCANCODE_W) direction = UP;    else
+                if (sc == SDL_SCANCODE_DOWN  || sc == SDL_SCANCODE_S) direction = DOWN;  else
+                if (sc == SDL_SCANCODE_LEFT  || sc == SDL_SCANCODE_A) direction = LEFT;  else
+                if (sc == SDL_SCANCODE_RIGHT || sc == SDL_SCANCODE_D) direction = RIGHT;
+                if (direction && session.health > 0) {
+                    update_world(world, &player, direction, &session);
+                }
+            }
+        }
+
+        int view_x = player.x - view_width / 2;
+        int view_y = player.y - view_height / 2;
+        load_chunks(world, view_x, view_y, view_width, view_height, CHUNK_SIZE / 2);
+
+        SDL_SetRenderDrawColor(renderer, 29, 32, 33, 255);
+        SDL_RenderClear(renderer);
+        for (int y = 0; y < view_height; ++y) {
+            for (int x = 0; x < view_width; ++x) {
+                Tile tile = *get_tile(world, view_x + x, view_y + y);
+                draw_sprite(tile.type, (x+1) * tile_size, (y+1) * tile_size);
+                draw_sprite(tile.entity, (x+1) * tile_size, (y+1) * tile_size);
+            }
+        }
+        draw_sprite(PLAYER,
+            (player.x - view_x + 1) * tile_size,
+            (player.y - view_y + 1) * tile_size);
+
+        draw_sprite(PLAYER, 32, 0);
+        draw_number(session.health, 72, 12);
+        draw_sprite(GOLD_SMALL, 160, 0);
+        draw_number(session.score, 200, 12);
+        draw_sprite(SPIDER, 416, 0);
+        draw_number(session.enemies_defeated, 456, 12);
+        SDL_RenderPresent(renderer);
+    }
+}
@@ -1,5 +1,8 @@
 #include <SDL2/SDL.h>
 #include "common.c"
+#include "level.c"
+#include "spectator.c"
+#include "level_pool.c"
 
 SDL_Window * window;
 SDL_Renderer * renderer;
@@ -42,19 +45,6 @@ enum {
     RIGHT,
 };
 
-enum {
-    FLOOR = 1,
-    SPIDER,
-    SPIKES,
-    PLAYER,
-    WALL,
-    EXIT,
-    LOCK,
-    KEY,
-    GOLD_SMALL,
-    GOLD_LARGE,
-};
-
 enum {
     MOVE_UP = 1,
     MOVE_DOWN,
@@ -100,61 +90,20 @@ void draw_sprite(int sprite_index, int x, int y) {
     }
 }
 
-typedef struct {
-    u8 type;
-    u8 entity;
-    u16 flags;
-} Tile;
-
-void generate_level(Tile * tiles, int width, int height) {
-    for (int x = 0; x < width; ++x) {
-        tiles[x + 0          * width] = (Tile){ .type = WALL };
-        tiles[x + (height-1) * width] = (Tile){ .type = WALL };
-    }
-    for (int y = 0; y < height; ++y) {
-        tiles[0         + y * width] = (Tile){ .type = WALL };
-        tiles[(width-1) + y * width] = (Tile){ .type = WALL };
-    }
-
-    for (int y = 1; y < height-1; ++y) {
-        for (int x = 1; x < width-1; ++x) {
-            Tile tile = {};
-
-            tile.type = chance(0.2f) ? WALL : FLOOR;
-
-            if (tile.type == FLOOR) {
-                if      (chance(0.05f)) tile.entity = GOLD_SMALL;
-                else if (chance(0.01f)) tile.entity = GOLD_LARGE;
-                else if (chance(0.03f)) tile.entity = SPIDER;
-                else if (chance(0.02f)) tile.type = SPIKES;
-            }
-
-            tiles[x + y * width] = tile;
-        }
-    }
-
-    {
-        Tile t = { .type = EXIT, .entity = LOCK };
-        int rx = random_int_range(1, width - 2);
-        int ry = random_int_range(1, height - 2);
-        tiles[rx + ry * width] = t;
-    }
-
-    {
-        Tile t = { .type = FLOOR, .entity = KEY };
-        int rx = random_int_range(1, width - 2);
-        int ry = random_int_range(1, height - 2);
-        tiles[rx + ry * width] = t;
-    }
-
-    {
-        Tile t = { .type = FLOOR, .entity = PLAYER };
-        int rx = random_int_range(1, width - 2);
-        int ry = random_int_range(1, height - 2);
-        tiles[rx + ry * width] = t;
-    }
+void * generate_pooled_level(void) {
+    Tile * tiles = malloc(level_width * level_height * sizeof(Tile));
+    if (!tiles) panic_exit("Could not allocate level.");
+    generate_level(tiles, level_width, level_height);
+    return tiles;
+}
 
+// Swaps in the next pre-generated level and tells the other player.
+Tile * next_level(LevelPool * pool, Tile * old_tiles) {
+    PooledLevel level = take_level(pool);
+    print_level_pool_stats(pool, level);
+    free(old_tiles);
     putchar('s');
+    return level.level;
 }
 
 bool update_level(Tile * tiles, int width, int height, int player_respection, Session * session, bool other_player_has_key) {
@@ -228,13 +177,174 @@ bool update_level(Tile * tiles, int width, int height, int player_respection, Se
 }
 
 
+/*
+    Client-side prediction, for when every move sent comes back as an
+    authoritative input, in order (run with -echo, as lag.sh does). Local
+    moves are applied to the board straight away and kept in a history, along
+    with the state after each one. When an input arrives it is checked
+    against the oldest unconfirmed move: if they agree that move is
+    confirmed, otherwise the board is rolled back to the last confirmed
+    state, the real input is applied in its place and the remaining moves are
+    re-simulated on top of it.
+
+    Between two machines (net.sh) stdin carries the other player's moves, not
+    an echo of ours, so nothing is predicted: our moves are only sent, and
+    theirs are applied to the confirmed state as they arrive, as before.
+*/
+
+#define MAX_PREDICTIONS 64
+
+typedef struct {
+    Tile * tiles;
+    Session session;
+    u64 random_seed[2];
+    bool finished;
+} Snapshot;
+
+typedef struct {
+    int width;
+    int height;
+    Snapshot confirmed;
+    Snapshot history[MAX_PREDICTIONS];
+    int directions[MAX_PREDICTIONS];
+    int first;
+    int count;
+    int unpredicted; // Moves sent without a prediction, still to come back.
+} Prediction;
+
+const char direction_chars[] = {
+    [UP]    = 'u',
+    [DOWN]  = 'd',
+    [LEFT]  = 'l',
+    [RIGHT] = 'r',
+};
+
+void save_snapshot(Snapshot * snapshot, Tile * tiles, int width, int height, Session * session) {
+    memcpy(snapshot->tiles, tiles, width * height * sizeof(*tiles));
+    snapshot->session = *session;
+    snapshot->random_seed[0] = xorshift128plus_random_seed[0];
+    snapshot->random_seed[1] = xorshift128plus_random_seed[1];
+}
+
+void load_snapshot(Snapshot * snapshot, Tile * tiles, int width, int height, Session * session) {
+    memcpy(tiles, snapshot->tiles, width * height * sizeof(*tiles));
+    *session = snapshot->session;
+    xorshift128plus_random_seed[0] = snapshot->random_seed[0];
+    xorshift128plus_random_seed[1] = snapshot->random_seed[1];
+}
+
+void init_prediction(Prediction * prediction, int width, int height) {
+    *prediction = (Prediction){ .width = width, .height = height };
+    prediction->confirmed.tiles = calloc(width * height, sizeof(Tile));
+    if (!prediction->confirmed.tiles) panic_exit("Could not allocate prediction.");
+    for (int i = 0; i < MAX_PREDICTIONS; ++i) {
+        prediction->history[i].tiles = calloc(width * height, sizeof(Tile));
+        if (!prediction->history[i].tiles) panic_exit("Could not allocate prediction.");
+    }
+}
+
+// Forget all unconfirmed moves and treat the current board as authoritative.
+void reset_prediction(Prediction * prediction, Tile * tiles, Session * session) {
+    prediction->first = 0;
+    prediction->count = 0;
+    prediction->unpredicted = 0;
+    save_snapshot(&prediction->confirmed, tiles,
+        prediction->width, prediction->height, session);
+}
+
+// Apply a local move immediately. The move is still sent if too many are
+// already waiting to be confirmed; it just waits for its echo like the rest,
+// and so do any moves after it, so the history stays in step with the echoes.
+void predict_move(Prediction * prediction, Tile * tiles, Session * session,
+    int direction, bool other_player_has_key) {
+    if (prediction->unpredicted || prediction->count == MAX_PREDICTIONS) {
+        prediction->unpredicted += 1;
+        return;
+    }
+
+    int i = (prediction->first + prediction->count) % MAX_PREDICTIONS;
+    Snapshot * snapshot = &prediction->history[i];
+    snapshot->finished = update_level(tiles, prediction->width, prediction->height,
+        direction, session, other_player_has_key);
+    save_snapshot(snapshot, tiles, prediction->width, prediction->height, session);
+    prediction->directions[i] = direction;
+    prediction->count += 1;
+}
+
+// Apply an authoritative move from the network, rolling back and
+// re-simulating if it disagrees with what was predicted. Returns true if the
+// move reached the exit.
+bool confirm_move(Prediction * prediction, Tile * tiles, Session * session,
+    int direction, bool other_player_has_key) {
+    int width  = prediction->width;
+    int height = prediction->height;
+
+    if (prediction->count && prediction->directions[prediction->first] == direction) {
+        // The prediction was right, so the board on screen is already correct
+        // and its snapshot becomes the confirmed one.
+        Snapshot * snapshot = &prediction->history[prediction->first];
+        Snapshot old = prediction->confirmed;
+        prediction->confirmed = *snapshot;
+        *snapshot = old;
+        prediction->first = (prediction->first + 1) % MAX_PREDICTIONS;
+        prediction->count -= 1;
+        return prediction->confirmed.finished;
+    }
+
+    load_snapshot(&prediction->confirmed, tiles, width, height, session);
+    bool finished = update_level(tiles, width, height,
+        direction, session, other_player_has_key);
+    save_snapshot(&prediction->confirmed, tiles, width, height, session);
+    prediction->confirmed.finished = finished;
+
+    if (prediction->count) {
+        // The authoritative input replaces the oldest prediction.
+        prediction->first = (prediction->first + 1) % MAX_PREDICTIONS;
+        prediction->count -= 1;
+    } else if (prediction->unpredicted) {
+        prediction->unpredicted -= 1;
+    }
+
+    for (int n = 0; n < prediction->count; ++n) {
+        int i = (prediction->first + n) % MAX_PREDICTIONS;
+        Snapshot * snapshot = &prediction->history[i];
+        snapshot->finished = update_level(tiles, width, height,
+            prediction->directions[i], session, other_player_has_key);
+        save_snapshot(snapshot, tiles, width, height, session);
+    }
+
+    return finished;
+}
+
+#define NET_QUEUE_SIZE 256
+
+// Single producer (the io thread), single consumer (the main loop).
+typedef struct {
+    char responses[NET_QUEUE_SIZE];
+    SDL_atomic_t head;
+    SDL_atomic_t tail;
+    bool has_key;
+} NetQueue;
+
+bool pop_net_response(NetQueue * queue, char * response) {
+    int head = SDL_AtomicGet(&queue->head);
+    if (head == SDL_AtomicGet(&queue->tail)) return false;
+    *response = queue->responses[head % NET_QUEUE_SIZE];
+    SDL_AtomicSet(&queue->head, head + 1);
+    return true;
+}
+
 int io_thread(void * data) {
+    NetQueue * queue = data;
     while (true) {
-        struct { char response; bool has_key; } * r = data;
-        char c = getchar();
-        r->has_key = c & BIT(7);
-        r->response = c & ~(BIT(7));
-        SDL_Delay(10);
+        int c = getchar();
+        if (c == EOF) return 0;
+        queue->has_key = c & BIT(7);
+        int tail = SDL_AtomicGet(&queue->tail);
+        if (tail - SDL_AtomicGet(&queue->head) < NET_QUEUE_SIZE) {
+            queue->responses[tail % NET_QUEUE_SIZE] = c & ~(BIT(7));
+            SDL_AtomicSet(&queue->tail, tail + 1);
+        }
     }
 }
 
@@ -285,50 +395,75 @@ int main(int argc, char ** argv) {
         SDL_FreeSurface(surface);
     }
 
-    Tile tiles[level_width * level_height];
-    generate_level(tiles, level_width, level_height);
+    LevelPool level_pool;
+    start_level_pool(&level_pool, 4, SDL_GetPerformanceCounter(), generate_pooled_level);
+    Tile * tiles = next_level(&level_pool, NULL);
     Session current_session = {
         .health = 10
     };
 
-    struct { char response; bool has_key; } net_response;
-    SDL_CreateThread(io_thread, "io", &net_response);
+    Prediction prediction;
+    init_prediction(&prediction, level_width, level_height);
+    reset_prediction(&prediction, tiles, &current_session);
+
+    NetQueue net_queue = {};
+    SDL_CreateThread(io_thread, "io", &net_queue);
+
+    // Usage: game [-echo] [spectator port]
+    bool echo = false;
+    int spectator_port = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-echo") == 0) echo = true;
+        else spectator_port = atoi(argv[i]);
+    }
+
+    // Spectators see the confirmed state: the board followed by the session.
+    int tiles_size = level_width * level_height * sizeof(Tile);
+    u8 spectator_state[tiles_size + sizeof(Session)];
+    Broadcaster spectators;
+    bool spectating = spectator_port &&
+        open_broadcaster(&spectators, spectator_port, sizeof(spectator_state));
 
     
     int end_time;
-    bool other_player_has_key = net_response.has_key;
+    bool other_player_has_key = net_queue.has_key;
     bool game_over = false;
 
     while (true) {
-        char response = net_response.response;
         SDL_Event event;
         //end_time = SDL_GetTicks() + 30 * 1000;
 
-
-        if(response == 's')
-        {
-            end_time = SDL_GetTicks() + 30 * 1000;
-            net_response.response = '\0';
-        }
         while (SDL_PollEvent(&event)) {
-            if (event.type == SDL_QUIT) exit(0);
+            if (event.type == SDL_QUIT) {
+                stop_level_pool(&level_pool, free);
+                exit(0);
+            }
 
             if (event.type == SDL_KEYDOWN) {
                 SDL_Scancode sc = event.key.keysym.scancode;
+                int direction = 0;
                 if (sc == SDL_SCANCODE_UP || sc == SDL_SCANCODE_W) {
-                    putchar('u');
+                    direction = UP;
                 }else if (sc == SDL_SCANCODE_DOWN || sc == SDL_SCANCODE_S) {
-                    putchar('d');
+                    direction = DOWN;
                 } else if (sc == SDL_SCANCODE_LEFT || sc == SDL_SCANCODE_A) {
-                    putchar('l');
+                    direction = LEFT;
                 } else if (sc == SDL_SCANCODE_RIGHT || sc == SDL_SCANCODE_D) {
-                    putchar('r');
+                    direction = RIGHT;
                 } else if (sc == SDL_SCANCODE_RETURN && !end_time) {
                     putchar('s');
                     end_time = SDL_GetTicks() + 30 * 1000;
                 } else if (sc == SDL_SCANCODE_R) {
                     current_session = (Session){.health = 10};
-                    generate_level(tiles, level_width, level_height);
+                    tiles = next_level(&level_pool, tiles);
+                    reset_prediction(&prediction, tiles, &current_session);
+                }
+                if (direction) {
+                    if (echo) {
+                        predict_move(&prediction, tiles, &current_session,
+                            direction, other_player_has_key);
+                    }
+                    putchar(direction_chars[direction]);
                 }
                 if (current_session.key_found) putchar('k');
                 fflush(stdout);
@@ -337,9 +472,11 @@ int main(int argc, char ** argv) {
         }
 
 
-        {
+        char response;
+        while (pop_net_response(&net_queue, &response)) {
             int player_direction = 0;
             //if () other_player_has_key = true;
+            if (response == 's') end_time = SDL_GetTicks() + 30 * 1000;
             if (response == 'u') player_direction = UP;   else
             if (response == 'd') player_direction = DOWN; else
             if (response == 'l') player_direction = LEFT; else
@@ -352,21 +489,26 @@ int main(int argc, char ** argv) {
             }
 
             if (player_direction) {
-                bool finished = update_level(tiles, level_width, level_height,
-                    player_direction, &current_session, other_player_has_key);
+                bool finished = confirm_move(&prediction, tiles, &current_session,
+                    player_direction, other_player_has_key);
                 if(finished) putchar('f');
-                if(finished && net_response.has_key)
+                if(finished && net_queue.has_key)
                 {
-                    generate_level(tiles, level_width, level_height);
+                    tiles = next_level(&level_pool, tiles);
                     current_session.levels_cleared += 1;
                     current_session.key_found = false;
+                    reset_prediction(&prediction, tiles, &current_session);
                 }
             }
-            net_response.response = '\0';
-
-            if (SDL_GetTicks() > end_time && end_time) putchar('e');
         }
 
+        if (SDL_GetTicks() > end_time && end_time) putchar('e');
+
+        if (spectating) {
+            memcpy(spectator_state, prediction.confirmed.tiles, tiles_size);
+            memcpy(spectator_state + tiles_size, &prediction.confirmed.session, sizeof(Session));
+            broadcast_state(&spectators, spectator_state);
+        }
 
         SDL_SetRenderDrawColor(renderer, 29, 32, 33, 255);
         SDL_RenderClear(renderer);
@@ -0,0 +1,35 @@
+#!/bin/bash
+# Echoes the game's output back into its input after a delay, for testing
+# prediction and rollback without a second machine. Bytes come back in the
+# order they were sent; the game is run with -echo so it predicts its own
+# moves. Usage: ./lag.sh [milliseconds]
+export LC_ALL=C
+delay=$(( ${1:-100} * 1000 ))
+pipe=$(mktemp -u)
+mkfifo $pipe
+trap "rm -f $pipe" EXIT
+
+now() {
+    echo $(( 10#${EPOCHREALTIME/./} ))
+}
+
+# Tag each byte with the time it arrived...
+stamp() {
+    while IFS= read -r -d '' -n 1 c; do
+        printf '%d %02x\n' $(now) "'$c"
+    done
+}
+
+# ...and send each one on once its delay has passed. Arrival times only go
+# up, so waiting on them in turn never reorders anything.
+release() {
+    while read -r arrived byte; do
+        wait=$(( arrived + delay - $(now) ))
+        if (( wait > 0 )); then
+            sleep $(printf '%d.%06d' $(( wait / 1000000 )) $(( wait % 1000000 )))
+        fi
+        printf "\\x$byte"
+    done
+}
+
+./game -echo < $pipe | stamp | release > $pipe
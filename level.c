@@ -0,0 +1,71 @@
+/*
+    level.c - Tile types and level generation, shared by the game and tools
+*/
+
+enum {
+    FLOOR = 1,
+    SPIDER,
+    SPIKES,
+    PLAYER,
+    WALL,
+    EXIT,
+    LOCK,
+    KEY,
+    GOLD_SMALL,
+    GOLD_LARGE,
+};
+
+typedef struct {
+    u8 type;
+    u8 entity;
+    u16 flags;
+} Tile;
+
+void generate_level(Tile * tiles, int width, int height) {
+    for (int x = 0; x < width; ++x) {
+        tiles[x + 0          * width] = (Tile){ .type = WALL };
+        tiles[x + (height-1) * width] = (Tile){ .type = WALL };
+    }
+    for (int y = 0; y < height; ++y) {
+        tiles[0         + y * width] = (Tile){ .type = WALL };
+        tiles[(width-1) + y * width] = (Tile){ .type = WALL };
+    }
+
+    for (int y = 1; y < height-1; ++y) {
+        for (int x = 1; x < width-1; ++x) {
+            Tile tile = {};
+
+            tile.type = chance(0.2f) ? WALL : FLOOR;
+
+            if (tile.type == FLOOR) {
+                if      (chance(0.05f)) tile.entity = GOLD_SMALL;
+                else if (chance(0.01f)) tile.entity = GOLD_LARGE;
+                else if (chance(0.03f)) tile.entity = SPIDER;
+                else if (chance(0.02f)) tile.type = SPIKES;
+            }
+
+            tiles[x + y * width] = tile;
+        }
+    }
+
+    {
+        Tile t = { .type = EXIT, .entity = LOCK };
+        int rx = random_int_range(1, width - 2);
+        int ry = random_int_range(1, height - 2);
+        tiles[rx + ry * width] = t;
+    }
+
+    {
+        Tile t = { .type = FLOOR, .entity = KEY };
+        int rx = random_int_range(1, width - 2);
+        int ry = random_int_range(1, height - 2);
+        tiles[rx + ry * width] = t;
+    }
+
+    {
+        Tile t = { .type = FLOOR, .entity = PLAYER };
+        int rx = random_int_range(1, width - 2);
+        int ry = random_int_range(1, height - 2);
+        tiles[rx + ry * width] = t;
+    }
+}
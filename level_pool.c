@@ -0,0 +1,137 @@
+/*
+    level_pool.c - Generates levels ahead of time on a worker thread
+
+    The worker keeps a bounded queue of finished levels topped up, so taking
+    the next level is just a pointer swap. Each level is generated with the
+    random number generator seeded from its own seed, which is returned with
+    the level so it can be reproduced.
+*/
+
+typedef void * (*GenerateLevelFunction)(void);
+typedef void (*DestroyLevelFunction)(void *);
+
+typedef struct {
+    void * level;
+    u64 seed;
+    float generation_ms;
+} PooledLevel;
+
+typedef struct {
+    int depth;
+    int capacity;
+    u64 generated;
+    float average_ms;
+    float max_ms;
+} LevelPoolStats;
+
+typedef struct {
+    GenerateLevelFunction generate;
+    PooledLevel * levels;
+    int capacity;
+    int first;
+    int count;
+    u64 next_seed;
+    bool quit;
+    SDL_mutex * lock;
+    SDL_cond * changed;
+    SDL_Thread * thread;
+    LevelPoolStats stats;
+    double total_ms;
+} LevelPool;
+
+int level_pool_thread(void * data) {
+    LevelPool * pool = data;
+    SDL_LockMutex(pool->lock);
+    while (true) {
+        while (!pool->quit && pool->count == pool->capacity) {
+            SDL_CondWait(pool->changed, pool->lock);
+        }
+        if (pool->quit) break;
+        u64 seed = pool->next_seed++;
+        SDL_UnlockMutex(pool->lock);
+
+        u64 start = SDL_GetPerformanceCounter();
+        seed_rng(seed, ~seed);
+        void * level = pool->generate();
+        float ms = (float)(SDL_GetPerformanceCounter() - start) * 1000.0f /
+            (float)SDL_GetPerformanceFrequency();
+
+        SDL_LockMutex(pool->lock);
+        int i = (pool->first + pool->count) % pool->capacity;
+        pool->levels[i] = (PooledLevel){ level, seed, ms };
+        pool->count += 1;
+        pool->total_ms += ms;
+        pool->stats.generated += 1;
+        pool->stats.average_ms = pool->total_ms / pool->stats.generated;
+        pool->stats.max_ms = MAX(pool->stats.max_ms, ms);
+        SDL_CondBroadcast(pool->changed);
+    }
+    SDL_UnlockMutex(pool->lock);
+    return 0;
+}
+
+void start_level_pool(LevelPool * pool, int capacity, u64 first_seed, GenerateLevelFunction generate) {
+    *pool = (LevelPool){
+        .generate = generate,
+        .capacity = capacity,
+        .next_seed = first_seed,
+    };
+    pool->levels = calloc(capacity, sizeof(PooledLevel));
+    if (!pool->levels) panic_exit("Could not allocate level pool.");
+    pool->lock = SDL_CreateMutex();
+    pool->changed = SDL_CreateCond();
+    if (!pool->lock || !pool->changed) {
+        panic_exit("Could not create level pool lock.\n(%s)", SDL_GetError());
+    }
+    pool->thread = SDL_CreateThread(level_pool_thread, "level pool", pool);
+    if (!pool->thread) {
+        panic_exit("Could not create level pool thread.\n(%s)", SDL_GetError());
+    }
+}
+
+void stop_level_pool(LevelPool * pool, DestroyLevelFunction destroy) {
+    SDL_LockMutex(pool->lock);
+    pool->quit = true;
+    SDL_CondBroadcast(pool->changed);
+    SDL_UnlockMutex(pool->lock);
+    SDL_WaitThread(pool->thread, NULL);
+
+    for (int n = 0; n < pool->count; ++n) {
+        destroy(pool->levels[(pool->first + n) % pool->capacity].level);
+    }
+    free(pool->levels);
+    SDL_DestroyCond(pool->changed);
+    SDL_DestroyMutex(pool->lock);
+}
+
+// Takes the oldest ready level, waiting for one if the queue is empty.
+PooledLevel take_level(LevelPool * pool) {
+    SDL_LockMutex(pool->lock);
+    while (pool->count == 0) {
+        SDL_CondWait(pool->changed, pool->lock);
+    }
+    PooledLevel level = pool->levels[pool->first];
+    pool->first = (pool->first + 1) % pool->capacity;
+    pool->count -= 1;
+    SDL_CondBroadcast(pool->changed);
+    SDL_UnlockMutex(pool->lock);
+    return level;
+}
+
+LevelPoolStats get_level_pool_stats(LevelPool * pool) {
+    SDL_LockMutex(pool->lock);
+    LevelPoolStats stats = pool->stats;
+    stats.depth = pool->count;
+    stats.capacity = pool->capacity;
+    SDL_UnlockMutex(pool->lock);
+    return stats;
+}
+
+// Reports on stderr, as stdout may be carrying network traffic.
+void print_level_pool_stats(LevelPool * pool, PooledLevel level) {
+    LevelPoolStats stats = get_level_pool_stats(pool);
+    fprintf(stderr, "level %llu: queue %d/%d, generated in %.3f ms (avg %.3f, max %.3f over %llu)\n",
+        (unsigned long long)level.seed, stats.depth, stats.capacity,
+        level.generation_ms, stats.average_ms, stats.max_ms,
+        (unsigned long long)stats.generated);
+}
@@ -1,5 +1,6 @@
 #include <SDL2/SDL.h>
 #include "common.c"
+#include "level_pool.c"
 
 SDL_Window * window;
 SDL_Renderer * renderer;
@@ -163,6 +164,14 @@ Level * generate_level(int width, int height) {
     return level;
 }
 
+void * generate_pooled_level(void) {
+    return generate_level(16, 16);
+}
+
+void destroy_pooled_level(void * level) {
+    destroy_level(level);
+}
+
 void update_level(Level * level, int direction) {}
 
 void draw_level(Level * level) {
@@ -191,7 +200,10 @@ int main(int argc, char ** argv) {
         panic_exit("Could not initialise SDL2.\n(%s)", SDL_GetError());
     }
 
-    Level * level = generate_level(16, 16);
+    LevelPool level_pool;
+    start_level_pool(&level_pool, 8, SDL_GetPerformanceCounter(), generate_pooled_level);
+    Level * level = take_level(&level_pool).level;
+    int levels_shown = 1;
 
     int window_width = 16 * tile_size;
     int window_height = 16 * tile_size;
@@ -211,8 +223,6 @@ int main(int argc, char ** argv) {
     SDL_RenderSetIntegerScale(renderer, true);
     SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
 
-    seed_rng(~SDL_GetPerformanceCounter(), SDL_GetTicks());
-
     {
         SDL_Surface * surface = SDL_LoadBMP("sheet.bmp");
         if (surface == NULL) {
@@ -240,10 +250,15 @@ int main(int argc, char ** argv) {
     while (true) {
         SDL_Event event;
         while (SDL_PollEvent(&event)) {
-            if (event.type == SDL_QUIT) exit(0);
+            if (event.type == SDL_QUIT) {
+                stop_level_pool(&level_pool, destroy_pooled_level);
+                exit(0);
+            }
         }
+        PooledLevel next = take_level(&level_pool);
+        if (++levels_shown % 100 == 0) print_level_pool_stats(&level_pool, next);
         destroy_level(level);
-        level = generate_level(16, 16);
+        level = next.level;
         SDL_RenderClear(renderer);
         draw_level(level);
         SDL_RenderPresent(renderer);
@@ -0,0 +1,565 @@
+/*
+    solver.c - Computes par scores for generated levels
+
+    Usage: solver [first seed] [count] [threads] [moves per second]
+
+    Each seed is generated the same way the level pool does it. For each
+    level this finds the fewest moves to pick up the key and reach the exit,
+    and the most gold that can be collected in a round, given how many moves
+    a player can make per second. Levels that cannot be finished are rejected
+    as degenerate; the rest are listed hardest first.
+
+    The par is a breadth first search over (position, has key). The gold
+    search runs over (last gold picked up, set of gold picked up) using the
+    precomputed distances between gold, keeping the fewest moves needed for
+    each state in a hashed transposition table. It is best first, starting
+    from the score of a greedy route. A state is dropped if it could not beat
+    the best score found even with every piece of gold costing only its
+    shortest way in, or if the same gold was reached having picked up
+    everything it has and more in as few moves.
+*/
+
+#include <SDL2/SDL.h>
+#include "common.c"
+#include "level.c"
+
+#define LEVEL_WIDTH  16
+#define LEVEL_HEIGHT 16
+#define LEVEL_TILES  (LEVEL_WIDTH * LEVEL_HEIGHT)
+#define MAX_GOLD     64
+#define UNREACHABLE  0xFFFF
+
+const int round_seconds = 30;
+
+const int neighbours[] = { -LEVEL_WIDTH, LEVEL_WIDTH, -1, 1 };
+
+typedef struct {
+    u64 seed;
+    bool degenerate;
+    int key_moves;
+    int par_moves;
+    int gold_count;
+    int gold_total;
+    int max_gold;
+    u64 states;
+    float ms;
+} Solution;
+
+typedef struct {
+    u64 mask;
+    u16 moves;
+    u8 node;
+    bool used;
+} TableEntry;
+
+typedef struct {
+    TableEntry * entries;
+    int capacity;
+    int count;
+} Table;
+
+typedef struct {
+    u64 mask;
+    u16 moves;
+    u16 score;
+    u16 bound;
+    u8 node;
+} SearchState;
+
+typedef struct {
+    SearchState * states;
+    int capacity;
+    int count;
+} Heap;
+
+// Every state expanded at one node, for finding states that are dominated.
+typedef struct {
+    u64 * masks;
+    u16 * moves;
+    int capacity;
+    int count;
+} Reached;
+
+typedef struct {
+    Table table;
+    Heap heap;
+    Reached reached[MAX_GOLD + 1];
+} Search;
+
+typedef struct {
+    Solution * solutions;
+    int count;
+    int moves_per_round;
+    SDL_atomic_t next;
+} Batch;
+
+u32 hash_state(u8 node, u64 mask, int capacity) {
+    u64 h = (mask ^ ((u64)node << 56)) * 0x9E3779B97F4A7C15ull;
+    return (u32)(h >> 32) & (capacity - 1);
+}
+
+TableEntry * find_entry(Table * table, u8 node, u64 mask) {
+    u32 h = hash_state(node, mask, table->capacity);
+    while (table->entries[h].used &&
+        (table->entries[h].node != node || table->entries[h].mask != mask)) {
+        h = (h + 1) & (table->capacity - 1);
+    }
+    return &table->entries[h];
+}
+
+void clear_table(Table * table) {
+    if (!table->entries) {
+        table->capacity = 1 << 12;
+        table->entries = malloc(table->capacity * sizeof(TableEntry));
+        if (!table->entries) panic_exit("Could not allocate transposition table.");
+    }
+    memset(table->entries, 0, table->capacity * sizeof(TableEntry));
+    table->count = 0;
+}
+
+void grow_table(Table * table) {
+    TableEntry * old = table->entries;
+    int old_capacity = table->capacity;
+    table->capacity *= 2;
+    table->entries = calloc(table->capacity, sizeof(TableEntry));
+    if (!table->entries) panic_exit("Could not allocate transposition table.");
+    for (int i = 0; i < old_capacity; ++i) {
+        if (old[i].used) *find_entry(table, old[i].node, old[i].mask) = old[i];
+    }
+    free(old);
+}
+
+// Records reaching a state in the given number of moves. Returns false if it
+// has already been reached in as few.
+bool improve_entry(Table * table, u8 node, u64 mask, u16 moves) {
+    TableEntry * entry = find_entry(table, node, mask);
+    if (entry->used) {
+        if (entry->moves <= moves) return false;
+        entry->moves = moves;
+        return true;
+    }
+    if ((table->count + 1) * 2 > table->capacity) {
+        grow_table(table);
+        entry = find_entry(table, node, mask);
+    }
+    *entry = (TableEntry){ mask, moves, node, true };
+    table->count += 1;
+    return true;
+}
+
+// The heap is ordered by most promising first: the highest bound on the
+// final score, then the most gold already collected, so routes are followed
+// through to a score quickly, then the fewest moves.
+bool state_before(SearchState a, SearchState b) {
+    if (a.bound != b.bound) return a.bound > b.bound;
+    if (a.score != b.score) return a.score > b.score;
+    return a.moves < b.moves;
+}
+
+void push_state(Heap * heap, SearchState state) {
+    if (heap->count == heap->capacity) {
+        heap->capacity = MAX(256, heap->capacity * 2);
+        heap->states = realloc(heap->states, heap->capacity * sizeof(SearchState));
+        if (!heap->states) panic_exit("Could not allocate search heap.");
+    }
+    int i = heap->count++;
+    while (i > 0 && state_before(state, heap->states[(i - 1) / 2])) {
+        heap->states[i] = heap->states[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap->states[i] = state;
+}
+
+// Records a state unless it is dominated: the same node was already reached
+// with all of the same gold and more, in as few moves, so anything this state
+// could go on to collect that one could too.
+bool add_reached(Reached * reached, u64 mask, u16 moves) {
+    for (int i = 0; i < reached->count; ++i) {
+        if ((reached->masks[i] & mask) == mask && reached->moves[i] <= moves) return false;
+    }
+    if (reached->count == reached->capacity) {
+        reached->capacity = MAX(64, reached->capacity * 2);
+        reached->masks = realloc(reached->masks, reached->capacity * sizeof(u64));
+        reached->moves = realloc(reached->moves, reached->capacity * sizeof(u16));
+        if (!reached->masks || !reached->moves) panic_exit("Could not allocate search states.");
+    }
+    reached->masks[reached->count] = mask;
+    reached->moves[reached->count] = moves;
+    reached->count += 1;
+    return true;
+}
+
+SearchState pop_state(Heap * heap) {
+    SearchState top = heap->states[0];
+    SearchState last = heap->states[--heap->count];
+    int i = 0;
+    while (true) {
+        int child = i * 2 + 1;
+        if (child >= heap->count) break;
+        if (child + 1 < heap->count &&
+            state_before(heap->states[child + 1], heap->states[child])) {
+            child += 1;
+        }
+        if (!state_before(heap->states[child], last)) break;
+        heap->states[i] = heap->states[child];
+        i = child;
+    }
+    heap->states[i] = last;
+    return top;
+}
+
+// Moves from one tile to every other, never passing through the exit, since
+// stepping onto it either fails or ends the level.
+void find_distances(Tile * tiles, int from, u16 * distances) {
+    int queue[LEVEL_TILES];
+    int first = 0;
+    int count = 0;
+    for (int i = 0; i < LEVEL_TILES; ++i) distances[i] = UNREACHABLE;
+    distances[from] = 0;
+    queue[count++] = from;
+    while (first < count) {
+        int pos = queue[first++];
+        for (int n = 0; n < 4; ++n) {
+            int next = pos + neighbours[n];
+            if (tiles[next].type == WALL || tiles[next].type == EXIT) continue;
+            if (distances[next] != UNREACHABLE) continue;
+            distances[next] = distances[pos] + 1;
+            queue[count++] = next;
+        }
+    }
+}
+
+// Fewest moves to pick up the key and then reach the exit, or -1.
+int find_par(Tile * tiles, int start, int * key_moves) {
+    u16 distances[2][LEVEL_TILES];
+    int queue[2 * LEVEL_TILES];
+    int first = 0;
+    int count = 0;
+    for (int i = 0; i < LEVEL_TILES; ++i) {
+        distances[0][i] = UNREACHABLE;
+        distances[1][i] = UNREACHABLE;
+    }
+    *key_moves = -1;
+    distances[0][start] = 0;
+    queue[count++] = start;
+    while (first < count) {
+        int key = queue[first] / LEVEL_TILES;
+        int pos = queue[first] % LEVEL_TILES;
+        first += 1;
+        for (int n = 0; n < 4; ++n) {
+            int next = pos + neighbours[n];
+            if (tiles[next].type == WALL) continue;
+            if (tiles[next].type == EXIT) {
+                if (key) return distances[key][pos] + 1;
+                continue;
+            }
+            int next_key = key || tiles[next].entity == KEY;
+            if (distances[next_key][next] != UNREACHABLE) continue;
+            distances[next_key][next] = distances[key][pos] + 1;
+            if (next_key && !key && *key_moves < 0) *key_moves = distances[1][next];
+            queue[count++] = next_key * LEVEL_TILES + next;
+        }
+    }
+    return -1;
+}
+
+typedef struct {
+    int count;
+    int values[MAX_GOLD];
+    u16 distances[MAX_GOLD + 1][MAX_GOLD];
+    u8 nearest[MAX_GOLD][MAX_GOLD - 1]; // Other gold, closest first.
+    int moves_per_round;
+} GoldMap;
+
+// Most gold that fits in the given moves, taking pieces by the best value
+// per move and then part of the last one that does not fit.
+int fill_moves(GoldMap * map, int * gold, int * costs, int count, int moves) {
+    int order[MAX_GOLD];
+    for (int n = 0; n < count; ++n) {
+        int i = n;
+        while (i > 0 && map->values[gold[n]] * costs[order[i - 1]] >
+            map->values[gold[order[i - 1]]] * costs[n]) {
+            order[i] = order[i - 1];
+            i -= 1;
+        }
+        order[i] = n;
+    }
+    int score = 0;
+    for (int i = 0; i < count && moves > 0; ++i) {
+        int n = order[i];
+        if (costs[n] <= moves) {
+            score += map->values[gold[n]];
+            moves -= costs[n];
+        } else {
+            score += map->values[gold[n]] * moves / costs[n];
+            moves = 0;
+        }
+    }
+    return score;
+}
+
+// An upper bound on the final score. Whichever route is taken, each piece of
+// gold still to be picked up is reached from the current node or from other
+// gold still to be picked up, so it costs at least the shortest of those
+// distances, and no route can beat filling the moves left at those costs.
+// If that takes everything in reach, a route through it all must also be at
+// least as long as its minimum spanning tree.
+int bound_score(GoldMap * map, SearchState state) {
+    int moves_left = map->moves_per_round - state.moves;
+    int gold[MAX_GOLD];
+    int costs[MAX_GOLD];
+    int count = 0;
+    int total = 0;
+    int smallest = 0;
+    for (int g = 0; g < map->count; ++g) {
+        if (state.mask & (1ull << g) || map->distances[state.node][g] > moves_left) continue;
+        int cost = map->distances[state.node][g];
+        for (int n = 0; n < map->count - 1; ++n) {
+            int h = map->nearest[g][n];
+            if (map->distances[h + 1][g] >= cost) break;
+            if (!(state.mask & (1ull << h))) {
+                cost = map->distances[h + 1][g];
+                break;
+            }
+        }
+        gold[count] = g;
+        costs[count] = cost;
+        smallest = count ? MIN(smallest, map->values[g]) : map->values[g];
+        total += map->values[g];
+        count += 1;
+    }
+
+    int reachable = fill_moves(map, gold, costs, count, moves_left);
+
+    if (reachable == total && count > 1) {
+        u16 nearest[MAX_GOLD];
+        bool joined[MAX_GOLD] = {};
+        for (int i = 0; i < count; ++i) nearest[i] = map->distances[state.node][gold[i]];
+        int length = 0;
+        for (int n = 0; n < count && length <= moves_left; ++n) {
+            int next = -1;
+            for (int i = 0; i < count; ++i) {
+                if (!joined[i] && (next < 0 || nearest[i] < nearest[next])) next = i;
+            }
+            joined[next] = true;
+            length += nearest[next];
+            for (int i = 0; i < count; ++i) {
+                nearest[i] = MIN(nearest[i], map->distances[gold[next] + 1][gold[i]]);
+            }
+        }
+        if (length > moves_left) reachable -= smallest;
+    }
+    return state.score + reachable;
+}
+
+// Always heading for the nearest gold gives a score to beat from the start.
+int greedy_score(GoldMap * map) {
+    SearchState state = {};
+    while (true) {
+        int nearest = -1;
+        for (int g = 0; g < map->count; ++g) {
+            if (state.mask & (1ull << g)) continue;
+            int d = map->distances[state.node][g];
+            if (state.moves + d > map->moves_per_round) continue;
+            if (nearest < 0 || d < map->distances[state.node][nearest]) nearest = g;
+        }
+        if (nearest < 0) return state.score;
+        state.mask |= 1ull << nearest;
+        state.moves += map->distances[state.node][nearest];
+        state.score += map->values[nearest];
+        state.node = nearest + 1;
+    }
+}
+
+// Most gold that can be collected within the given number of moves. Node 0
+// is the start, node g + 1 is gold g.
+int find_max_gold(Tile * tiles, int start, int moves_per_round,
+    Search * search, u64 * states_searched) {
+    GoldMap map = { .moves_per_round = moves_per_round };
+    int gold_tiles[MAX_GOLD];
+    for (int i = 0; i < LEVEL_TILES && map.count < MAX_GOLD; ++i) {
+        if (tiles[i].entity == GOLD_SMALL || tiles[i].entity == GOLD_LARGE) {
+            gold_tiles[map.count] = i;
+            map.values[map.count] = tiles[i].entity == GOLD_SMALL ? 3 : 20;
+            map.count += 1;
+        }
+    }
+
+    {
+        u16 from_tile[LEVEL_TILES];
+        for (int node = 0; node <= map.count; ++node) {
+            find_distances(tiles, node ? gold_tiles[node - 1] : start, from_tile);
+            for (int g = 0; g < map.count; ++g) {
+                map.distances[node][g] = from_tile[gold_tiles[g]];
+            }
+        }
+    }
+    for (int g = 0; g < map.count; ++g) {
+        int n = 0;
+        for (int h = 0; h < map.count; ++h) {
+            if (h == g) continue;
+            int i = n++;
+            while (i > 0 && map.distances[map.nearest[g][i - 1] + 1][g] > map.distances[h + 1][g]) {
+                map.nearest[g][i] = map.nearest[g][i - 1];
+                i -= 1;
+            }
+            map.nearest[g][i] = h;
+        }
+    }
+
+    int best = greedy_score(&map);
+
+    Table * table = &search->table;
+    Heap * heap = &search->heap;
+    clear_table(table);
+    heap->count = 0;
+    for (int node = 0; node <= map.count; ++node) search->reached[node].count = 0;
+
+    SearchState first = {};
+    first.bound = bound_score(&map, first);
+    improve_entry(table, 0, 0, 0);
+    push_state(heap, first);
+
+    while (heap->count) {
+        SearchState state = pop_state(heap);
+        if (find_entry(table, state.node, state.mask)->moves < state.moves) continue;
+        // Nothing left on the heap can do better.
+        if (state.bound <= best) break;
+        if (!add_reached(&search->reached[state.node], state.mask, state.moves)) continue;
+        *states_searched += 1;
+        best = MAX(best, state.score);
+
+        for (int g = 0; g < map.count; ++g) {
+            int d = map.distances[state.node][g];
+            if (state.mask & (1ull << g) || state.moves + d > moves_per_round) continue;
+            SearchState next = {
+                .mask = state.mask | (1ull << g),
+                .moves = state.moves + d,
+                .score = state.score + map.values[g],
+                .node = g + 1,
+            };
+            // The bound only depends on the state, so a state already
+            // reached in as few moves is never worth bounding again.
+            if (!improve_entry(table, next.node, next.mask, next.moves)) continue;
+            next.bound = bound_score(&map, next);
+            if (next.bound > best) push_state(heap, next);
+        }
+    }
+    return best;
+}
+
+void solve_level(u64 seed, int moves_per_round, Search * search, Solution * solution) {
+    u64 start_time = SDL_GetPerformanceCounter();
+    *solution = (Solution){ .seed = seed };
+
+    Tile tiles[LEVEL_TILES];
+    seed_rng(seed, ~seed);
+    generate_level(tiles, LEVEL_WIDTH, LEVEL_HEIGHT);
+
+    // Later pieces can be placed on top of earlier ones, so any may be missing.
+    int start = -1;
+    bool has_key = false;
+    bool has_exit = false;
+    for (int i = 0; i < LEVEL_TILES; ++i) {
+        if (tiles[i].entity == PLAYER) start = i;
+        if (tiles[i].entity == KEY) has_key = true;
+        if (tiles[i].type == EXIT) has_exit = true;
+        if (tiles[i].entity == GOLD_SMALL) solution->gold_total += 3;
+        if (tiles[i].entity == GOLD_LARGE) solution->gold_total += 20;
+        if (tiles[i].entity == GOLD_SMALL || tiles[i].entity == GOLD_LARGE) {
+            solution->gold_count += 1;
+        }
+    }
+
+    if (start < 0 || !has_key || !has_exit) {
+        solution->degenerate = true;
+    } else {
+        solution->par_moves = find_par(tiles, start, &solution->key_moves);
+        solution->degenerate = solution->par_moves < 0;
+        solution->max_gold = find_max_gold(tiles, start, moves_per_round,
+            search, &solution->states);
+    }
+
+    solution->ms = (float)(SDL_GetPerformanceCounter() - start_time) * 1000.0f /
+        (float)SDL_GetPerformanceFrequency();
+}
+
+int solver_thread(void * data) {
+    Batch * batch = data;
+    Search * search = calloc(1, sizeof(Search));
+    if (!search) panic_exit("Could not allocate search.");
+    int i;
+    while ((i = SDL_AtomicAdd(&batch->next, 1)) < batch->count) {
+        solve_level(batch->solutions[i].seed, batch->moves_per_round,
+            search, &batch->solutions[i]);
+    }
+    free(search->table.entries);
+    free(search->heap.states);
+    for (int node = 0; node <= MAX_GOLD; ++node) {
+        free(search->reached[node].masks);
+        free(search->reached[node].moves);
+    }
+    free(search);
+    return 0;
+}
+
+// Hardest first, with degenerate levels at the end.
+int compare_solutions(const void * a, const void * b) {
+    const Solution * x = a;
+    const Solution * y = b;
+    if (x->degenerate != y->degenerate) return x->degenerate - y->degenerate;
+    if (x->par_moves != y->par_moves) return y->par_moves - x->par_moves;
+    return (x->seed > y->seed) - (x->seed < y->seed);
+}
+
+int main(int argc, char ** argv) {
+    u64 first_seed      = argc > 1 ? strtoull(argv[1], NULL, 0) : 1;
+    int count           = argc > 2 ? atoi(argv[2]) : 1000;
+    int thread_count    = argc > 3 ? atoi(argv[3]) : SDL_GetCPUCount();
+    int moves_per_second = argc > 4 ? atoi(argv[4]) : 4;
+    thread_count = CLAMP(1, thread_count, 256);
+
+    Batch batch = {
+        .count = count,
+        .moves_per_round = MIN(round_seconds * moves_per_second, UNREACHABLE - 1),
+    };
+    batch.solutions = calloc(count, sizeof(Solution));
+    if (!batch.solutions) panic_exit("Could not allocate solutions.");
+    for (int i = 0; i < count; ++i) batch.solutions[i].seed = first_seed + i;
+
+    u64 start_time = SDL_GetPerformanceCounter();
+    SDL_Thread * threads[256];
+    for (int t = 0; t < thread_count; ++t) {
+        threads[t] = SDL_CreateThread(solver_thread, "solver", &batch);
+        if (!threads[t]) panic_exit("Could not create solver thread.\n(%s)", SDL_GetError());
+    }
+    for (int t = 0; t < thread_count; ++t) SDL_WaitThread(threads[t], NULL);
+    float total_ms = (float)(SDL_GetPerformanceCounter() - start_time) * 1000.0f /
+        (float)SDL_GetPerformanceFrequency();
+
+    qsort(batch.solutions, count, sizeof(Solution), compare_solutions);
+
+    int degenerate = 0;
+    float max_ms = 0;
+    double sum_ms = 0;
+    printf("%20s %5s %5s %5s %9s %10s %8s\n",
+        "seed", "par", "key", "gold", "max gold", "states", "ms");
+    for (int i = 0; i < count; ++i) {
+        Solution * s = &batch.solutions[i];
+        sum_ms += s->ms;
+        max_ms = MAX(max_ms, s->ms);
+        if (s->degenerate) {
+            degenerate += 1;
+            printf("%20llu  rejected: cannot be finished\n", (unsigned long long)s->seed);
+            continue;
+        }
+        printf("%20llu %5d %5d %5d %4d/%-4d %10llu %8.3f\n",
+            (unsigned long long)s->seed, s->par_moves, s->key_moves, s->gold_count,
+            s->max_gold, s->gold_total, (unsigned long long)s->states, s->ms);
+    }
+    printf("\n%d levels, %d rejected, %d moves per round, %d threads\n",
+        count, degenerate, batch.moves_per_round, thread_count);
+    printf("%.3f ms per level on average, %.3f ms at most, %.1f ms in total\n",
+        sum_ms / MAX(1, count), max_ms, total_ms);
+    return 0;
+}
@@ -0,0 +1,321 @@
+/*
+    spectator.c - Streams game state to read-only spectators over UDP
+
+    The broadcaster keeps a copy of the last state it sent. Each tick the new
+    state is diffed against it and encoded once into a shared packet, which is
+    then sent as-is to every subscriber.
+
+    Spectators talk to the broadcaster's port with one byte datagrams:
+        'h'  subscribe, or ask for a fresh keyframe after missing a tick
+        'a'  keepalive, to be sent every SPECTATE_KEEPALIVE_MS
+        'q'  unsubscribe
+    A new subscriber is sent a keyframe of the current state first. Anyone
+    not heard from for SPECTATE_TIMEOUT_MS is dropped, and no more than
+    MAX_SPECTATORS are served at once, so a forged or abandoned subscription
+    only costs a few seconds of traffic.
+
+    Packets, in host byte order:
+        u8  kind         SPECTATE_KEYFRAME or SPECTATE_DELTA
+        u32 tick
+        u16 state size
+    followed, for a keyframe, by the whole state, or for a delta by runs of
+        u16 offset
+        u8  length
+        u8  bytes[length]
+*/
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+enum {
+    SPECTATE_KEYFRAME = 'K',
+    SPECTATE_DELTA    = 'D',
+};
+
+#define SPECTATE_HEADER_SIZE  7
+#define SPECTATE_MAX_PACKET   65507
+#define SPECTATE_KEEPALIVE_MS 1000
+#define SPECTATE_TIMEOUT_MS   5000
+#define MAX_SPECTATORS        4096
+#define SPECTATOR_TABLE_SIZE  (MAX_SPECTATORS * 2) // Power of two.
+
+typedef struct {
+    struct sockaddr_in address;
+    u32 last_heard;
+    bool joining; // Still to be sent its first keyframe.
+} Spectator;
+
+typedef struct {
+    int socket;
+    Spectator * spectators;
+    int spectator_count;
+    int joiner_count;
+    int * table; // Spectator index + 1 by address, or 0 if empty.
+    u8 * state;
+    int state_size;
+    u8 * packet;
+    u32 tick;
+    u64 bytes_encoded;
+    u64 bytes_sent;
+    u64 spectators_dropped;
+} Broadcaster;
+
+bool open_broadcaster(Broadcaster * b, int port, int state_size) {
+    *b = (Broadcaster){};
+    if (state_size + SPECTATE_HEADER_SIZE > SPECTATE_MAX_PACKET) {
+        issue_warning("Spectator state too large (%d bytes).", state_size);
+        return false;
+    }
+
+    b->socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (b->socket < 0) {
+        issue_warning("Could not create spectator socket.");
+        return false;
+    }
+    struct sockaddr_in address = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    if (bind(b->socket, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        issue_warning("Could not bind spectator port %d.", port);
+        close(b->socket);
+        return false;
+    }
+    fcntl(b->socket, F_SETFL, fcntl(b->socket, F_GETFL) | O_NONBLOCK);
+    // Room for a burst of keepalives from every spectator between ticks.
+    int receive_buffer = MAX_SPECTATORS * 512;
+    setsockopt(b->socket, SOL_SOCKET, SO_RCVBUF, &receive_buffer, sizeof(receive_buffer));
+
+    b->state_size = state_size;
+    b->state = calloc(state_size, 1);
+    b->packet = calloc(state_size + SPECTATE_HEADER_SIZE, 1);
+    b->spectators = calloc(MAX_SPECTATORS, sizeof(Spectator));
+    b->table = calloc(SPECTATOR_TABLE_SIZE, sizeof(int));
+    if (!b->state || !b->packet || !b->spectators || !b->table) {
+        panic_exit("Could not allocate spectator buffers.");
+    }
+    return true;
+}
+
+void close_broadcaster(Broadcaster * b) {
+    close(b->socket);
+    free(b->spectators);
+    free(b->table);
+    free(b->state);
+    free(b->packet);
+    *b = (Broadcaster){};
+}
+
+u32 hash_address(struct sockaddr_in address) {
+    return ((u32)address.sin_addr.s_addr * 73856093u ^ (u32)address.sin_port * 19349663u) &
+        (SPECTATOR_TABLE_SIZE - 1);
+}
+
+int find_spectator(Broadcaster * b, struct sockaddr_in address) {
+    for (u32 h = hash_address(address); b->table[h]; h = (h + 1) & (SPECTATOR_TABLE_SIZE - 1)) {
+        Spectator * spectator = &b->spectators[b->table[h] - 1];
+        if (spectator->address.sin_addr.s_addr == address.sin_addr.s_addr &&
+            spectator->address.sin_port == address.sin_port) {
+            return b->table[h] - 1;
+        }
+    }
+    return -1;
+}
+
+u32 find_table_slot(Broadcaster * b, int index) {
+    u32 h = hash_address(b->spectators[index].address);
+    while (b->table[h] != index + 1) h = (h + 1) & (SPECTATOR_TABLE_SIZE - 1);
+    return h;
+}
+
+void add_spectator(Broadcaster * b, struct sockaddr_in address, u32 now) {
+    int index = b->spectator_count++;
+    b->spectators[index] = (Spectator){ address, now, true };
+    b->joiner_count += 1;
+    u32 h = hash_address(address);
+    while (b->table[h]) h = (h + 1) & (SPECTATOR_TABLE_SIZE - 1);
+    b->table[h] = index + 1;
+}
+
+// Removes a spectator, moving the last one into its place. Entries that
+// probed past its slot in the table are shifted back so lookups never stop
+// early.
+void remove_spectator(Broadcaster * b, int index) {
+    u32 mask = SPECTATOR_TABLE_SIZE - 1;
+    u32 h = find_table_slot(b, index);
+    b->table[h] = 0;
+    for (u32 next = (h + 1) & mask; b->table[next]; next = (next + 1) & mask) {
+        u32 home = hash_address(b->spectators[b->table[next] - 1].address);
+        // Move it back into the hole unless its home lies between the hole
+        // and where it is now.
+        if (((next - home) & mask) >= ((next - h) & mask)) {
+            b->table[h] = b->table[next];
+            b->table[next] = 0;
+            h = next;
+        }
+    }
+
+    if (b->spectators[index].joining) b->joiner_count -= 1;
+    int last = --b->spectator_count;
+    if (index != last) {
+        b->table[find_table_slot(b, last)] = index + 1;
+        b->spectators[index] = b->spectators[last];
+    }
+}
+
+void accept_spectators(Broadcaster * b) {
+    u32 now = SDL_GetTicks();
+    u8 message[16];
+    struct sockaddr_in address;
+    while (true) {
+        socklen_t length = sizeof(address);
+        int size = recvfrom(b->socket, message, sizeof(message), 0,
+            (struct sockaddr *)&address, &length);
+        // Empty datagrams are ignored rather than taken as the end of the
+        // queue, or a stream of them would hold back everyone's keepalives.
+        if (size < 0) break;
+        if (size == 0) continue;
+        int s = find_spectator(b, address);
+
+        if (message[0] == 'a') {
+            if (s >= 0) b->spectators[s].last_heard = now;
+        } else if (message[0] == 'q') {
+            if (s >= 0) remove_spectator(b, s);
+        } else if (message[0] == 'h') {
+            if (s < 0) {
+                if (b->spectator_count < MAX_SPECTATORS) add_spectator(b, address, now);
+                continue;
+            }
+            b->spectators[s].last_heard = now;
+            if (!b->spectators[s].joining) {
+                b->spectators[s].joining = true;
+                b->joiner_count += 1;
+            }
+        }
+    }
+
+    for (int i = 0; i < b->spectator_count; ++i) {
+        if (now - b->spectators[i].last_heard > SPECTATE_TIMEOUT_MS) {
+            remove_spectator(b, i--);
+            b->spectators_dropped += 1;
+        }
+    }
+}
+
+void write_header(u8 * packet, u8 kind, u32 tick, u16 state_size) {
+    packet[0] = kind;
+    memcpy(packet + 1, &tick, sizeof(tick));
+    memcpy(packet + 5, &state_size, sizeof(state_size));
+}
+
+int encode_keyframe(Broadcaster * b) {
+    write_header(b->packet, SPECTATE_KEYFRAME, b->tick, b->state_size);
+    memcpy(b->packet + SPECTATE_HEADER_SIZE, b->state, b->state_size);
+    return SPECTATE_HEADER_SIZE + b->state_size;
+}
+
+// Encodes the changes from the last sent state to the new one, updating the
+// last sent state as it goes. Returns the packet size, 0 if nothing changed,
+// or -1 if the delta would be no smaller than a keyframe.
+int encode_delta(Broadcaster * b, u8 * state) {
+    int limit = SPECTATE_HEADER_SIZE + b->state_size;
+    int size = SPECTATE_HEADER_SIZE;
+    write_header(b->packet, SPECTATE_DELTA, b->tick + 1, b->state_size);
+
+    int i = 0;
+    while (i < b->state_size) {
+        if (state[i] == b->state[i]) {
+            ++i;
+            continue;
+        }
+        int start = i;
+        while (i < b->state_size && i - start < 255 && state[i] != b->state[i]) ++i;
+        int run = i - start;
+        if (size + 3 + run >= limit) {
+            memcpy(b->state, state, b->state_size);
+            return -1;
+        }
+        u16 offset = start;
+        memcpy(b->packet + size, &offset, sizeof(offset));
+        b->packet[size + 2] = run;
+        memcpy(b->packet + size + 3, state + start, run);
+        memcpy(b->state + start, state + start, run);
+        size += 3 + run;
+    }
+
+    return size > SPECTATE_HEADER_SIZE ? size : 0;
+}
+
+// Sends the packet to every spectator that is, or is not, joining.
+void send_packet(Broadcaster * b, int size, bool joining) {
+    for (int i = 0; i < b->spectator_count; ++i) {
+        Spectator * spectator = &b->spectators[i];
+        if (spectator->joining != joining) continue;
+        if (sendto(b->socket, b->packet, size, 0,
+            (struct sockaddr *)&spectator->address, sizeof(spectator->address)) == size) {
+            b->bytes_sent += size;
+        }
+    }
+}
+
+// Sends one tick of state to every spectator. The delta and keyframe are each
+// encoded at most once, whatever the number of subscribers. The tick only
+// advances when the state has changed.
+void broadcast_state(Broadcaster * b, u8 * state) {
+    accept_spectators(b);
+
+    int size = encode_delta(b, state);
+    if (size != 0) b->tick += 1;
+    if (size > 0) {
+        b->bytes_encoded += size;
+        send_packet(b, size, false);
+    }
+
+    if (size < 0 || b->joiner_count) {
+        int keyframe_size = encode_keyframe(b);
+        b->bytes_encoded += keyframe_size;
+        if (size < 0) send_packet(b, keyframe_size, false);
+        send_packet(b, keyframe_size, true);
+    }
+
+    if (b->joiner_count) {
+        for (int i = 0; i < b->spectator_count; ++i) b->spectators[i].joining = false;
+        b->joiner_count = 0;
+    }
+}
+
+// Applies a received packet to a spectator's copy of the state. Returns false
+// if the packet does not follow on from the last one applied, in which case
+// the spectator should ask for a keyframe.
+bool apply_spectator_packet(u8 * state, int state_size, u32 * tick, u8 * packet, int size) {
+    if (size < SPECTATE_HEADER_SIZE) return false;
+    u32 packet_tick;
+    u16 packet_state_size;
+    memcpy(&packet_tick, packet + 1, sizeof(packet_tick));
+    memcpy(&packet_state_size, packet + 5, sizeof(packet_state_size));
+    if (packet_state_size != state_size) return false;
+
+    if (packet[0] == SPECTATE_KEYFRAME) {
+        if (size != SPECTATE_HEADER_SIZE + state_size) return false;
+        memcpy(state, packet + SPECTATE_HEADER_SIZE, state_size);
+        *tick = packet_tick;
+        return true;
+    }
+
+    if (packet[0] != SPECTATE_DELTA || packet_tick != *tick + 1) return false;
+
+    for (int i = SPECTATE_HEADER_SIZE; i + 3 <= size;) {
+        u16 offset;
+        memcpy(&offset, packet + i, sizeof(offset));
+        int run = packet[i + 2];
+        if (i + 3 + run > size || offset + run > state_size) return false;
+        memcpy(state + offset, packet + i + 3, run);
+        i += 3 + run;
+    }
+    *tick = packet_tick;
+    return true;
+}
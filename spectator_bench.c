@@ -0,0 +1,135 @@
+/*
+    spectator_bench.c - Measures spectator fan-out over loopback
+
+    Usage: spectator_bench [spectators] [ticks]
+
+    Streams a 16x16 board plus session to the given number of local
+    spectators, changing a few tiles each tick the way a move would. Reports
+    the bytes encoded and sent per tick and the broadcaster's CPU time per
+    tick and per spectator, then checks every spectator ended up in sync.
+*/
+
+#include <SDL2/SDL.h>
+#include <sys/resource.h>
+#include <time.h>
+#include "common.c"
+#include "spectator.c"
+
+int main(int argc, char ** argv) {
+    int spectator_count = argc > 1 ? atoi(argv[1]) : 1000;
+    int tick_count      = argc > 2 ? atoi(argv[2]) : 1000;
+    const int port = 4242;
+    const int tile_count = 16 * 16;
+    const int tile_size = 4;
+    const int state_size = tile_count * tile_size + 5 * sizeof(int);
+
+    struct rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+
+    Broadcaster broadcaster;
+    if (!open_broadcaster(&broadcaster, port, state_size)) return 1;
+
+    int * sockets = calloc(spectator_count, sizeof(int));
+    u8 * states = calloc(spectator_count, state_size);
+    u32 * ticks = calloc(spectator_count, sizeof(u32));
+    bool * joined = calloc(spectator_count, sizeof(bool));
+    u32 * last_sent = calloc(spectator_count, sizeof(u32));
+    u32 * last_received = calloc(spectator_count, sizeof(u32));
+    u8 * state = calloc(state_size, 1);
+    u8 * packet = malloc(SPECTATE_MAX_PACKET);
+    if (!sockets || !states || !ticks || !joined || !last_sent || !last_received || !state || !packet) {
+        panic_exit("Could not allocate spectators.");
+    }
+
+    struct sockaddr_in server = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    for (int i = 0; i < spectator_count; ++i) {
+        sockets[i] = socket(AF_INET, SOCK_DGRAM, 0);
+        if (sockets[i] < 0) panic_exit("Could only open %d spectator sockets.", i);
+        fcntl(sockets[i], F_SETFL, fcntl(sockets[i], F_GETFL) | O_NONBLOCK);
+        sendto(sockets[i], "h", 1, 0, (struct sockaddr *)&server, sizeof(server));
+    }
+
+    // Spread the keepalives out, as real spectators would join at
+    // different times.
+    seed_rng(~SDL_GetPerformanceCounter(), SDL_GetTicks());
+    for (int i = 0; i < spectator_count; ++i) {
+        last_sent[i] = SDL_GetTicks() - random_int_range(0, SPECTATE_KEEPALIVE_MS);
+    }
+    for (int i = 0; i < tile_count; ++i) {
+        state[i * tile_size] = random_int_range(1, 10);
+    }
+
+    clock_t broadcast_clocks = 0;
+    int resyncs = 0;
+    for (int t = 0; t < tick_count; ++t) {
+        // A move shifts the player and a couple of spiders, and sometimes
+        // touches the score.
+        for (int m = 0; m < 3; ++m) {
+            int from = random_int_range(0, tile_count - 1);
+            int to   = random_int_range(0, tile_count - 1);
+            state[to * tile_size + 1] = state[from * tile_size + 1];
+            state[from * tile_size + 1] = random_int_range(0, 10);
+        }
+        if (chance(0.2f)) state[tile_count * tile_size] += 3;
+
+        clock_t start = clock();
+        broadcast_state(&broadcaster, state);
+        broadcast_clocks += clock() - start;
+
+        for (int i = 0; i < spectator_count; ++i) {
+            u8 * spectator_state = states + i * state_size;
+            int size;
+            u32 now = SDL_GetTicks();
+            while ((size = recv(sockets[i], packet, SPECTATE_MAX_PACKET, 0)) > 0) {
+                joined[i] = true;
+                last_received[i] = now;
+                if (!apply_spectator_packet(spectator_state, state_size, &ticks[i], packet, size)) {
+                    sendto(sockets[i], "h", 1, 0, (struct sockaddr *)&server, sizeof(server));
+                    resyncs += 1;
+                }
+            }
+            // The broadcaster's receive buffer can overflow when thousands
+            // join at once, so keep asking until a keyframe arrives.
+            // The state changes every tick, so silence means this spectator
+            // was dropped and has to subscribe again.
+            if (joined[i] && now - last_received[i] > SPECTATE_TIMEOUT_MS) {
+                joined[i] = false;
+            }
+            if (!joined[i]) {
+                sendto(sockets[i], "h", 1, 0, (struct sockaddr *)&server, sizeof(server));
+                last_sent[i] = now;
+            } else if (now - last_sent[i] >= SPECTATE_KEEPALIVE_MS) {
+                sendto(sockets[i], "a", 1, 0, (struct sockaddr *)&server, sizeof(server));
+                last_sent[i] = now;
+            }
+        }
+    }
+
+    int in_sync = 0;
+    for (int i = 0; i < spectator_count; ++i) {
+        if (memcmp(states + i * state_size, state, state_size) == 0) in_sync += 1;
+    }
+
+    double cpu_us = (double)broadcast_clocks / CLOCKS_PER_SEC * 1e6;
+    printf("spectators:            %d\n", broadcaster.spectator_count);
+    printf("ticks:                 %d\n", tick_count);
+    printf("state size:            %d bytes\n", state_size);
+    printf("encoded per tick:      %.1f bytes\n", (double)broadcaster.bytes_encoded / tick_count);
+    printf("sent per tick:         %.1f bytes\n", (double)broadcaster.bytes_sent / tick_count);
+    printf("cpu per tick:          %.1f us\n", cpu_us / tick_count);
+    printf("cpu per spectator:     %.1f ns\n",
+        cpu_us * 1000 / tick_count / MAX(1, broadcaster.spectator_count));
+    printf("resyncs:               %d\n", resyncs);
+    printf("timed out:             %llu\n", (unsigned long long)broadcaster.spectators_dropped);
+    printf("in sync at end:        %d/%d\n", in_sync, spectator_count);
+
+    for (int i = 0; i < spectator_count; ++i) close(sockets[i]);
+    close_broadcaster(&broadcaster);
+    return in_sync == spectator_count ? 0 : 1;
+}